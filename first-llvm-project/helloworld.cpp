@@ -1,35 +1,814 @@
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/BinaryFormat/Magic.h"
 #include "llvm/Bitcode/BitcodeReader.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
+#include "llvm/MC/MCAsmInfo.h"
+#include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCInstrAnalysis.h"
+#include "llvm/MC/MCObjectFileInfo.h"
+#include "llvm/MC/MCParser/MCAsmParser.h"
+#include "llvm/MC/MCParser/MCTargetAsmParser.h"
+#include "llvm/MC/MCStreamer.h"
+#include "llvm/MC/MCTargetOptions.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/MCA/Context.h"
+#include "llvm/MCA/CustomBehaviour.h"
+#include "llvm/MCA/InstrBuilder.h"
+#include "llvm/MCA/Pipeline.h"
+#include "llvm/MCA/SourceMgr.h"
+#include "llvm/MCA/Support.h"
+#include "llvm/Object/Archive.h"
+#include "llvm/Object/IRObjectFile.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Support/xxhash.h"
 #include "llvm/Support/raw_os_ostream.h"
 //#include "llvm/Support/system_error.h"
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <map>
+#include <vector>
 
 using namespace llvm;
 
-static cl::opt<std::string> FileName(cl::Positional, cl::desc("Bitcode file"),
-cl::Required);
+static cl::list<std::string> FileNames(cl::Positional,
+cl::desc("<bitcode, archive or object files>"));
+static cl::opt<std::string> IndexPath("index",
+cl::desc("Function index file"), cl::value_desc("file"));
+static cl::opt<bool> BuildIndex("build-index",
+cl::desc("Add or update the functions defined in the inputs in -index, "
+         "reusing the entries of unchanged files; files indexed before keep "
+         "their entries until they are deleted"));
+static cl::list<std::string> Queries("query",
+cl::desc("Look up a function in -index"), cl::value_desc("name"));
+static cl::opt<bool> CostMode("cost",
+cl::desc("Estimate the cost of each defined function with the target cost "
+         "model"));
+static cl::opt<std::string> MCPU("mcpu",
+cl::desc("Target CPU for -cost (default: host CPU)"), cl::value_desc("cpu"));
+static cl::opt<bool> UseMCA("mca",
+cl::desc("With -cost, also simulate each machine block with llvm-mca"));
+static cl::opt<unsigned> MCAIterations("mca-iterations",
+cl::desc("Iterations simulated per block by -mca"), cl::init(100));
+static cl::opt<unsigned> TopN("top",
+cl::desc("Number of blocks flagged by -cost"), cl::init(5));
+
+// Called for every module read.  Name is empty for a standalone .bc file,
+// else the archive member or object it came from.
+typedef function_ref<void(const std::string &Name, Module &M)> ModuleVisitor;
+
+// Visit the module in Buffer.
+static bool analyzeBitcode(MemoryBufferRef Buffer, const std::string &Name,
+		LLVMContext &context, ModuleVisitor Visit) {
+	Expected<std::unique_ptr<Module>> m = parseBitcodeFile(Buffer, context);
+	if (!m) {
+		std::cerr << "Error reading bitcode" << (Name.empty() ? "" : " in ")
+		          << Name << ": " << toString(m.takeError()) << "\n";
+		return false;
+	}
+	Visit(Name, **m);
+	return true;
+}
+
+// Analyze Buffer in place: a bitcode file, an object file with an embedded
+// .llvmbc section, or an archive of either.  Archive members are slices of
+// the parent buffer, so nothing is copied or extracted to disk.
+static bool analyzeBuffer(MemoryBufferRef Buffer, const std::string &Name,
+		LLVMContext &context, ModuleVisitor Visit) {
+	file_magic Magic = identify_magic(Buffer.getBuffer());
+	if (Magic == file_magic::bitcode)
+		return analyzeBitcode(Buffer, Name, context, Visit);
+
+	if (Magic == file_magic::archive) {
+		Expected<std::unique_ptr<object::Archive>> a =
+			object::Archive::create(Buffer);
+		if (!a) {
+			std::cerr << "Error reading archive " << Buffer.getBufferIdentifier().str()
+			          << ": " << toString(a.takeError()) << "\n";
+			return false;
+		}
+		bool ok = true;
+		Error err = Error::success();
+		for (const object::Archive::Child &c : (*a)->children(err)) {
+			Expected<MemoryBufferRef> slice = c.getMemoryBufferRef();
+			if (!slice) {
+				std::cerr << "Error reading member of "
+				          << Buffer.getBufferIdentifier().str() << ": "
+				          << toString(slice.takeError()) << "\n";
+				ok = false;
+				continue;
+			}
+			std::string memberName = (Buffer.getBufferIdentifier() + "(" +
+				slice->getBufferIdentifier() + ")").str();
+			ok &= analyzeBuffer(*slice, memberName, context, Visit);
+		}
+		if (err) {
+			std::cerr << "Error reading archive " << Buffer.getBufferIdentifier().str()
+			          << ": " << toString(std::move(err)) << "\n";
+			return false;
+		}
+		return ok;
+	}
+
+	// Objects built with -fembed-bitcode carry the module in .llvmbc.
+	// Archives may mix them with native objects, which are skipped; only
+	// an input file without bitcode is an error.
+	Expected<MemoryBufferRef> bc = object::IRObjectFile::findBitcodeInMemBuffer(
+		Buffer);
+	if (!bc) {
+		if (!Name.empty()) {
+			consumeError(bc.takeError());
+			std::cerr << "Skipping " << Name << ": no bitcode\n";
+			return true;
+		}
+		std::cerr << "No bitcode in " << Buffer.getBufferIdentifier().str() << ": "
+		          << toString(bc.takeError()) << "\n";
+		return false;
+	}
+	return analyzeBitcode(*bc, Name.empty() ? Buffer.getBufferIdentifier().str() :
+		Name, context, Visit);
+}
+
+// Function index file, written by -build-index and mapped by -query.  All
+// fields are host-endian; the header is followed by these arrays:
+//   IndexFile[NumFiles]      inputs, with the mtime and size they had
+//   IndexFunction[NumFuncs]  sorted by name
+//   uint32_t[NumBuckets]     open-addressed hash table of function
+//                            index + 1 (0 = empty), NumBuckets a power of 2
+//   char[StringsSize]        names, not NUL terminated
+struct IndexHeader {
+	char Magic[8];
+	uint32_t NumFiles, NumFuncs, NumBuckets, StringsSize;
+	uint64_t FilesOffset, FuncsOffset, BucketsOffset, StringsOffset;
+};
+
+struct IndexFile {
+	uint32_t NameOffset, NameSize;
+	int64_t ModTime;
+	uint64_t Size;
+};
+
+struct IndexFunction {
+	uint32_t NameOffset, NameSize;
+	uint32_t ModuleOffset, ModuleSize;  // archive member or file name
+	uint32_t File, Hash;
+	uint32_t Blocks, Instructions;
+};
+
+static const char IndexMagic[8] = "FNIDX01";
+
+// A function while the index is being built
+struct IndexEntry {
+	std::string Name, Module;
+	unsigned File, Blocks, Instructions;
+};
+
+// A mapped index file, or an invalid one if it could not be read.
+class FunctionIndex {
+	std::unique_ptr<MemoryBuffer> Buffer;
+	const IndexHeader *Header = nullptr;
+	template <class T> const T *array(uint64_t Offset) const {
+		return reinterpret_cast<const T *>(Buffer->getBufferStart() + Offset);
+	}
+
+public:
+	explicit FunctionIndex(StringRef Path) {
+		ErrorOr<std::unique_ptr<MemoryBuffer>> mb = MemoryBuffer::getFile(Path,
+			/*IsText=*/false, /*RequiresNullTerminator=*/false);
+		if (!mb || (*mb)->getBufferSize() < sizeof(IndexHeader))
+			return;
+		Buffer = std::move(*mb);
+		const IndexHeader *h =
+			reinterpret_cast<const IndexHeader *>(Buffer->getBufferStart());
+		uint64_t size = Buffer->getBufferSize();
+		if (memcmp(h->Magic, IndexMagic, sizeof(IndexMagic)) != 0 ||
+		    !isPowerOf2_32(h->NumBuckets) ||
+		    h->FilesOffset + uint64_t(h->NumFiles) * sizeof(IndexFile) > size ||
+		    h->FuncsOffset + uint64_t(h->NumFuncs) * sizeof(IndexFunction) > size ||
+		    h->BucketsOffset + uint64_t(h->NumBuckets) * 4 > size ||
+		    h->StringsOffset + h->StringsSize > size)
+			return;
+		Header = h;
+	}
+
+	bool valid() const { return Header != nullptr; }
+	ArrayRef<IndexFile> files() const {
+		return makeArrayRef(array<IndexFile>(Header->FilesOffset),
+			Header->NumFiles);
+	}
+	ArrayRef<IndexFunction> functions() const {
+		return makeArrayRef(array<IndexFunction>(Header->FuncsOffset),
+			Header->NumFuncs);
+	}
+	StringRef string(uint32_t Offset, uint32_t Size) const {
+		if (uint64_t(Offset) + Size > Header->StringsSize)
+			return StringRef();
+		return StringRef(array<char>(Header->StringsOffset) + Offset, Size);
+	}
+
+	// All functions called Name, one per defining module.
+	std::vector<const IndexFunction *> lookup(StringRef Name) const {
+		std::vector<const IndexFunction *> found;
+		const uint32_t *buckets = array<uint32_t>(Header->BucketsOffset);
+		uint32_t hash = uint32_t(xxHash64(Name)), mask = Header->NumBuckets - 1;
+		for (uint32_t b = hash & mask, n = 0; n != Header->NumBuckets;
+		     b = (b + 1) & mask, ++n) {
+			uint32_t slot = buckets[b];
+			if (slot == 0 || slot > Header->NumFuncs)
+				break;
+			const IndexFunction &f = functions()[slot - 1];
+			if (f.Hash == hash && string(f.NameOffset, f.NameSize) == Name)
+				found.push_back(&f);
+		}
+		return found;
+	}
+};
+
+// Write Entries (for the inputs in Files) to Path, via a temporary file so
+// that a mapped old index stays intact until the new one is complete.
+static bool writeIndex(StringRef Path, ArrayRef<std::string> Files,
+		ArrayRef<sys::fs::file_status> Status,
+		std::vector<IndexEntry> &Entries) {
+	std::sort(Entries.begin(), Entries.end(),
+		[](const IndexEntry &a, const IndexEntry &b) {
+			return std::tie(a.Name, a.Module) < std::tie(b.Name, b.Module);
+		});
+
+	std::string strings;
+	StringMap<uint32_t> stringOffsets;
+	auto addString = [&](StringRef str) {
+		auto it = stringOffsets.insert(std::make_pair(str, strings.size()));
+		if (it.second)
+			strings += str.str();
+		return it.first->second;
+	};
+
+	std::vector<IndexFile> files;
+	for (unsigned i = 0, e = Files.size(); i != e; ++i) {
+		IndexFile f;
+		f.NameOffset = addString(Files[i]);
+		f.NameSize = Files[i].size();
+		f.ModTime = Status[i].getLastModificationTime().time_since_epoch().count();
+		f.Size = Status[i].getSize();
+		files.push_back(f);
+	}
+
+	uint32_t numBuckets = std::max(16u, uint32_t(NextPowerOf2(Entries.size() * 2)));
+	std::vector<uint32_t> buckets(numBuckets, 0);
+	std::vector<IndexFunction> funcs;
+	for (const IndexEntry &entry : Entries) {
+		IndexFunction f;
+		f.NameOffset = addString(entry.Name);
+		f.NameSize = entry.Name.size();
+		f.ModuleOffset = addString(entry.Module);
+		f.ModuleSize = entry.Module.size();
+		f.File = entry.File;
+		f.Hash = uint32_t(xxHash64(entry.Name));
+		f.Blocks = entry.Blocks;
+		f.Instructions = entry.Instructions;
+		uint32_t b = f.Hash & (numBuckets - 1);
+		while (buckets[b] != 0)
+			b = (b + 1) & (numBuckets - 1);
+		funcs.push_back(f);
+		buckets[b] = funcs.size();
+	}
+
+	IndexHeader h;
+	memcpy(h.Magic, IndexMagic, sizeof(IndexMagic));
+	h.NumFiles = files.size();
+	h.NumFuncs = funcs.size();
+	h.NumBuckets = numBuckets;
+	h.StringsSize = strings.size();
+	h.FilesOffset = sizeof(h);
+	h.FuncsOffset = h.FilesOffset + files.size() * sizeof(IndexFile);
+	h.BucketsOffset = h.FuncsOffset + funcs.size() * sizeof(IndexFunction);
+	h.StringsOffset = h.BucketsOffset + buckets.size() * sizeof(uint32_t);
+
+	std::string tmp = (Path + ".tmp").str();
+	std::error_code ec;
+	{
+		raw_fd_ostream os(tmp, ec);
+		if (!ec) {
+			os.write(reinterpret_cast<const char *>(&h), sizeof(h));
+			os.write(reinterpret_cast<const char *>(files.data()),
+				files.size() * sizeof(IndexFile));
+			os.write(reinterpret_cast<const char *>(funcs.data()),
+				funcs.size() * sizeof(IndexFunction));
+			os.write(reinterpret_cast<const char *>(buckets.data()),
+				buckets.size() * sizeof(uint32_t));
+			os << strings;
+			os.close();
+			ec = os.error();
+		}
+	}
+	if (!ec)
+		ec = sys::fs::rename(tmp, Path);
+	if (ec) {
+		std::cerr << "Error writing " << Path.str() << ": " << ec.message() << "\n";
+		sys::fs::remove(tmp);
+		return false;
+	}
+	return true;
+}
+
+// Index the functions of FileNames into IndexPath.  Files of the old
+// index that are not named are indexed again too, and dropped once they
+// no longer exist.  Inputs whose mtime and size match the old index keep
+// their old entries unparsed.  Inputs that cannot be read are left out,
+// so the next build tries them again.
+static int buildIndex(LLVMContext &context) {
+	FunctionIndex old(IndexPath);
+	StringMap<unsigned> oldFiles;
+	std::vector<std::vector<const IndexFunction *>> oldFunctions;
+	std::vector<std::string> inputs(FileNames.begin(), FileNames.end());
+	if (old.valid()) {
+		oldFunctions.resize(old.files().size());
+		for (const IndexFunction &fn : old.functions())
+			if (fn.File < oldFunctions.size())
+				oldFunctions[fn.File].push_back(&fn);
+		StringSet<> named;
+		for (const std::string &fileName : FileNames)
+			named.insert(fileName);
+		for (unsigned i = 0, e = old.files().size(); i != e; ++i) {
+			const IndexFile &f = old.files()[i];
+			StringRef name = old.string(f.NameOffset, f.NameSize);
+			oldFiles[name] = i;
+			if (!named.count(name))
+				inputs.push_back(name.str());
+		}
+	}
+
+	std::vector<std::string> files;
+	std::vector<sys::fs::file_status> status;
+	std::vector<IndexEntry> entries;
+	unsigned reused = 0;
+	int result = 0;
+	for (unsigned in = 0, e = inputs.size(); in != e; ++in) {
+		const std::string &fileName = inputs[in];
+		sys::fs::file_status st;
+		if (std::error_code ec = sys::fs::status(fileName, st)) {
+			if (in >= FileNames.size() && ec == std::errc::no_such_file_or_directory) {
+				std::cerr << "Dropping " << fileName << ": no longer exists\n";
+				continue;
+			}
+			std::cerr << "Error reading " << fileName << ": " << ec.message() << "\n";
+			result = -1;
+			continue;
+		}
+		unsigned fileNo = files.size();
+		files.push_back(fileName);
+		status.push_back(st);
+
+		auto it = oldFiles.find(fileName);
+		if (it != oldFiles.end()) {
+			const IndexFile &f = old.files()[it->second];
+			if (f.ModTime == st.getLastModificationTime().time_since_epoch().count() &&
+			    f.Size == st.getSize()) {
+				for (const IndexFunction *fn : oldFunctions[it->second])
+					entries.push_back({old.string(fn->NameOffset, fn->NameSize).str(),
+						old.string(fn->ModuleOffset, fn->ModuleSize).str(),
+						fileNo, fn->Blocks, fn->Instructions});
+				++reused;
+				continue;
+			}
+		}
+
+		ErrorOr<std::unique_ptr<MemoryBuffer>> mb = MemoryBuffer::getFile(fileName);
+		if (!mb) {
+			std::cerr << "Error reading " << fileName << ": "
+			          << mb.getError().message() << "\n";
+			files.pop_back();
+			status.pop_back();
+			result = -1;
+			continue;
+		}
+		size_t firstEntry = entries.size();
+		bool ok = analyzeBuffer((*mb)->getMemBufferRef(), "", context,
+			[&](const std::string &Name, Module &M) {
+				for (const Function &F : M) {
+					if (!F.isDeclaration())
+						entries.push_back({F.getName().str(),
+							Name.empty() ? fileName : Name, fileNo, unsigned(F.size()),
+							F.getInstructionCount()});
+				}
+			});
+		if (!ok) {
+			std::cerr << "Not indexing " << fileName << "\n";
+			entries.resize(firstEntry);
+			files.pop_back();
+			status.pop_back();
+			result = -1;
+		}
+	}
+
+	if (!writeIndex(IndexPath, files, status, entries))
+		return -1;
+	std::cout << entries.size() << " function(s) from " << files.size()
+	          << " file(s), " << reused << " unchanged.\n";
+	return result;
+}
+
+static int queryIndex() {
+	FunctionIndex index(IndexPath);
+	if (!index.valid()) {
+		std::cerr << "Error reading index " << IndexPath << "\n";
+		return -1;
+	}
+	raw_os_ostream O(std::cout);
+	int result = 0;
+	for (const std::string &name : Queries) {
+		std::vector<const IndexFunction *> found = index.lookup(name);
+		if (found.empty()) {
+			O << name << " not found.\n";
+			result = 1;
+		}
+		for (const IndexFunction *f : found)
+			O << name << " in " << index.string(f->ModuleOffset, f->ModuleSize)
+			  << ": " << f->Blocks << " basic block(s), " << f->Instructions
+			  << " instruction(s).\n";
+	}
+	return result;
+}
+
+// Cost mode: sum the target cost model over each defined function and,
+// with -mca, simulate each machine basic block with the llvm-mca library.
+struct CostEntry {
+	std::string Name;  // function, or function:block
+	double Throughput, Latency;
+};
+
+struct MCAEntry {
+	std::string Name;  // function:machine block
+	double CyclesPerIteration;
+	std::vector<std::pair<std::string, double>> Pressure;  // cycles/iteration
+};
+
+struct CostReport {
+	std::vector<CostEntry> Functions, Blocks;
+	std::vector<MCAEntry> MCABlocks;
+};
+
+// The target machine for Triple and CPU, created once per pair.
+static TargetMachine *getTargetMachine(const std::string &Triple,
+		const std::string &CPU) {
+	static std::map<std::string, std::unique_ptr<TargetMachine>> machines;
+	std::unique_ptr<TargetMachine> &tm = machines[Triple + " " + CPU];
+	if (tm)
+		return tm.get();
+	std::string error;
+	const Target *target = TargetRegistry::lookupTarget(Triple, error);
+	if (!target) {
+		std::cerr << "Error: " << error << "\n";
+		return nullptr;
+	}
+	// Verbose assembly marks blocks without labels; see simulateModule().
+	TargetOptions options;
+	options.MCOptions.AsmVerbose = true;
+	tm.reset(target->createTargetMachine(Triple, CPU, "", options, None));
+	return tm.get();
+}
+
+// Collects the instructions the assembly parser reads, and nothing else.
+class InstCollector : public MCStreamer {
+public:
+	std::vector<MCInst> Insts;
+	explicit InstCollector(MCContext &Ctx) : MCStreamer(Ctx) {}
+	void emitInstruction(const MCInst &Inst, const MCSubtargetInfo &) override {
+		Insts.push_back(Inst);
+	}
+	bool emitSymbolAttribute(MCSymbol *, MCSymbolAttr) override { return true; }
+	void emitCommonSymbol(MCSymbol *, uint64_t, unsigned) override {}
+	void emitZerofill(MCSection *, MCSymbol *, uint64_t, unsigned,
+		SMLoc) override {}
+};
+
+// Adds up the cycles each processor resource is busy.
+class PressureListener : public mca::HWEventListener {
+	DenseMap<uint64_t, unsigned> MaskToResource;
+public:
+	std::vector<double> Cycles;
+	explicit PressureListener(const MCSchedModel &SM) {
+		SmallVector<uint64_t, 32> masks(SM.getNumProcResourceKinds());
+		mca::computeProcResourceMasks(SM, masks);
+		for (unsigned i = 1, e = masks.size(); i != e; ++i)
+			MaskToResource[masks[i]] = i;
+		Cycles.resize(masks.size());
+	}
+	void onEvent(const mca::HWInstructionEvent &Event) override {
+		if (Event.Type != mca::HWInstructionEvent::Issued)
+			return;
+		const auto &issued = static_cast<const mca::HWInstructionIssuedEvent &>(
+			Event);
+		for (const mca::ResourceUse &use : issued.UsedResources) {
+			auto it = MaskToResource.find(use.first.first);
+			if (it != MaskToResource.end())
+				Cycles[it->second] += double(use.second.getNumerator()) /
+					use.second.getDenominator();
+		}
+	}
+};
+
+// Run llvm-mca over the instructions in Asm (one machine basic block).
+static bool simulateBlock(TargetMachine &TM, StringRef Asm, MCAEntry &Entry) {
+	const Target &target = TM.getTarget();
+	const Triple &triple = TM.getTargetTriple();
+	const MCRegisterInfo &mri = *TM.getMCRegisterInfo();
+	const MCAsmInfo &mai = *TM.getMCAsmInfo();
+	const MCInstrInfo &mcii = *TM.getMCInstrInfo();
+	const MCSubtargetInfo &sti = *TM.getMCSubtargetInfo();
+	std::unique_ptr<MCInstrAnalysis> mcia(target.createMCInstrAnalysis(&mcii));
+
+	SourceMgr srcMgr;
+	srcMgr.AddNewSourceBuffer(MemoryBuffer::getMemBufferCopy(Asm), SMLoc());
+	MCContext ctx(triple, &mai, &mri, &sti, &srcMgr);
+	std::unique_ptr<MCObjectFileInfo> mofi(
+		target.createMCObjectFileInfo(ctx, /*PIC=*/false));
+	ctx.setObjectFileInfo(mofi.get());
+	InstCollector collector(ctx);
+	std::unique_ptr<MCAsmParser> parser(
+		createMCAsmParser(srcMgr, ctx, collector, mai));
+	std::unique_ptr<MCTargetAsmParser> tap(
+		target.createMCAsmParser(sti, *parser, mcii, MCTargetOptions()));
+	if (!tap)
+		return false;
+	parser->setTargetParser(*tap);
+	if (parser->Run(/*NoInitialTextSection=*/false))
+		return false;
+
+	mca::InstrBuilder builder(sti, mcii, mri, mcia.get());
+	std::vector<std::unique_ptr<mca::Instruction>> insts;
+	for (const MCInst &mci : collector.Insts) {
+		// The block is simulated as a loop, so a return is not part of it.
+		if (mcii.get(mci.getOpcode()).isReturn())
+			continue;
+		Expected<std::unique_ptr<mca::Instruction>> inst =
+			builder.createInstruction(mci);
+		if (!inst) {
+			consumeError(inst.takeError());
+			return false;
+		}
+		insts.push_back(std::move(*inst));
+	}
+	if (insts.empty())
+		return false;
+
+	mca::SourceMgr source(insts, MCAIterations);
+	mca::CustomBehaviour cb(sti, source, mcii);
+	mca::Context mca(mri, sti);
+	mca::PipelineOptions po(0, 0, 0, 0, 0, 0, /*NoAlias=*/true);
+	std::unique_ptr<mca::Pipeline> pipeline =
+		mca.createDefaultPipeline(po, source, cb);
+	const MCSchedModel &sm = sti.getSchedModel();
+	PressureListener listener(sm);
+	pipeline->addEventListener(&listener);
+	Expected<unsigned> cycles = pipeline->run();
+	if (!cycles) {
+		consumeError(cycles.takeError());
+		return false;
+	}
+
+	unsigned iterations = source.getNumIterations();
+	Entry.CyclesPerIteration = double(*cycles) / iterations;
+	for (unsigned i = 1, e = listener.Cycles.size(); i != e; ++i) {
+		if (listener.Cycles[i] > 0)
+			Entry.Pressure.push_back(std::make_pair(
+				std::string(sm.getProcResource(i)->Name),
+				listener.Cycles[i] / iterations));
+	}
+	std::sort(Entry.Pressure.begin(), Entry.Pressure.end(),
+		[](const std::pair<std::string, double> &a,
+		   const std::pair<std::string, double> &b) { return a.second > b.second; });
+	return true;
+}
+
+// Compile M to assembly and simulate each machine basic block of its
+// defined functions.  Blocks are found from the labels and "%bb.N:"
+// comments the asm printer emits; only instruction lines are kept.
+static void simulateModule(TargetMachine &TM, Module &M,
+		const std::string &Prefix, CostReport &Report) {
+	SmallString<0> asmText;
+	raw_svector_ostream os(asmText);
+	legacy::PassManager pm;
+	if (TM.addPassesToEmitFile(pm, os, nullptr, CGFT_AssemblyFile)) {
+		std::cerr << "Error: cannot emit assembly for "
+		          << TM.getTargetTriple().str() << "\n";
+		return;
+	}
+	pm.run(M);
+
+	StringSet<> functions;
+	for (const Function &F : M)
+		if (!F.isDeclaration())
+			functions.insert(F.getName());
+
+	StringRef comment = TM.getMCAsmInfo()->getCommentString();
+	std::string function, block, body;
+	auto flush = [&]() {
+		MCAEntry entry;
+		entry.Name = function + ":" + block;
+		if (!function.empty() && !body.empty() &&
+		    simulateBlock(TM, body, entry))
+			Report.MCABlocks.push_back(std::move(entry));
+		body.clear();
+	};
+
+	SmallVector<StringRef, 0> lines;
+	StringRef(asmText).split(lines, '\n');
+	for (StringRef line : lines) {
+		StringRef trimmed = line.trim();
+		if (trimmed.empty())
+			continue;
+		if (line.startswith(".Lfunc_end")) {
+			flush();
+			function.clear();
+			continue;
+		}
+		if (trimmed.startswith(".") && !trimmed.startswith(".LBB"))
+			continue;
+		if (!isSpace(line.front())) {
+			// A label, or a "%bb.N:" comment for a block without one.
+			StringRef label = line;
+			if (label.startswith(comment))
+				label = label.drop_front(comment.size()).ltrim();
+			size_t colon = label.find(':');
+			if (colon == StringRef::npos)
+				continue;
+			StringRef name = label.take_front(colon);
+			if (!label.startswith("%bb.") && !label.startswith(".LBB") &&
+			    !functions.count(name))
+				continue;
+			flush();
+			if (functions.count(name)) {
+				function = (Prefix.empty() ? "" : Prefix + ": ") + name.str();
+				block = "entry";
+			} else {
+				// Prefer the IR block name the asm printer puts in a comment.
+				size_t irName = label.find(comment.str() + " %", colon);
+				block = irName == StringRef::npos ? name.str() :
+					label.drop_front(irName + comment.size() + 2).trim().str();
+			}
+			continue;
+		}
+		if (trimmed.startswith(comment))
+			continue;
+		body += trimmed.str();
+		body += '\n';
+	}
+	flush();
+}
+
+// Sum the cost model over every defined function and block of M.
+static void costModule(const std::string &Name, Module &M,
+		CostReport &Report) {
+	std::string triple = M.getTargetTriple().empty() ?
+		sys::getDefaultTargetTriple() : M.getTargetTriple();
+	std::string cpu = MCPU;
+	if (cpu.empty() && Triple(triple).getArch() ==
+	    Triple(sys::getProcessTriple()).getArch())
+		cpu = sys::getHostCPUName().str();
+	TargetMachine *tm = getTargetMachine(triple, cpu);
+	if (!tm)
+		return;
+	M.setDataLayout(tm->createDataLayout());
+
+	for (Function &F : M) {
+		if (F.isDeclaration())
+			continue;
+		// Per-function attributes would override the chosen CPU.
+		F.removeFnAttr("tune-cpu");
+		F.addFnAttr("target-cpu", cpu);
+		std::string fnName = (Name.empty() ? "" : Name + ": ") +
+			F.getName().str();
+		TargetTransformInfo tti = tm->getTargetTransformInfo(F);
+		CostEntry fnCost = {fnName, 0, 0};
+		unsigned blockNo = 0;
+		for (const BasicBlock &BB : F) {
+			CostEntry bbCost = {fnName + ":" + (BB.hasName() ? BB.getName().str() :
+				"%bb" + std::to_string(blockNo)), 0, 0};
+			++blockNo;
+			for (const Instruction &I : BB) {
+				if (auto c = tti.getInstructionCost(&I,
+				    TargetTransformInfo::TCK_RecipThroughput).getValue())
+					bbCost.Throughput += *c;
+				if (auto c = tti.getInstructionCost(&I,
+				    TargetTransformInfo::TCK_Latency).getValue())
+					bbCost.Latency += *c;
+			}
+			fnCost.Throughput += bbCost.Throughput;
+			fnCost.Latency += bbCost.Latency;
+			Report.Blocks.push_back(bbCost);
+		}
+		Report.Functions.push_back(fnCost);
+	}
+	if (UseMCA)
+		simulateModule(*tm, M, Name, Report);
+}
+
+static void printCostReport(CostReport &Report, raw_ostream &O) {
+	auto byThroughput = [](const CostEntry &a, const CostEntry &b) {
+		return a.Throughput > b.Throughput;
+	};
+	std::stable_sort(Report.Functions.begin(), Report.Functions.end(),
+		byThroughput);
+	std::stable_sort(Report.Blocks.begin(), Report.Blocks.end(), byThroughput);
+
+	O << "Cost (reciprocal throughput / latency) per function:\n";
+	for (const CostEntry &c : Report.Functions)
+		O << "  " << c.Name << ": " << format("%.1f / %.1f", c.Throughput,
+			c.Latency) << "\n";
+	O << "Most expensive blocks:\n";
+	for (unsigned i = 0, e = std::min<size_t>(TopN, Report.Blocks.size());
+	     i != e; ++i)
+		O << "  " << Report.Blocks[i].Name << ": " << format("%.1f / %.1f",
+			Report.Blocks[i].Throughput, Report.Blocks[i].Latency) << "\n";
+
+	if (!UseMCA)
+		return;
+	std::stable_sort(Report.MCABlocks.begin(), Report.MCABlocks.end(),
+		[](const MCAEntry &a, const MCAEntry &b) {
+			return a.CyclesPerIteration > b.CyclesPerIteration;
+		});
+	O << "Most expensive machine blocks (llvm-mca, cycles/iteration):\n";
+	for (unsigned i = 0, e = std::min<size_t>(TopN, Report.MCABlocks.size());
+	     i != e; ++i) {
+		const MCAEntry &b = Report.MCABlocks[i];
+		O << "  " << b.Name << ": " << format("%.2f", b.CyclesPerIteration);
+		for (unsigned j = 0, je = std::min<size_t>(3, b.Pressure.size());
+		     j != je; ++j)
+			O << (j == 0 ? ", pressure " : ", ") << b.Pressure[j].first << " "
+			  << format("%.2f", b.Pressure[j].second);
+		O << "\n";
+	}
+}
 
 int main(int argc, char** argv) {
 	cl::ParseCommandLineOptions(argc, argv, "LLVM hello world\n");
 	LLVMContext context;
-	std::string error;
-	std::unique_ptr<MemoryBuffer> mb;
-	MemoryBuffer::getFile(FileName, mb);
-
-	Module *m = llvm::parseBitcodeFile(mb.get(), context, &error);
-	if (m == 0) {
-		std::cerr << "Error reading bitcode: " << error << "\n";
+	if ((BuildIndex || !Queries.empty()) && IndexPath.empty()) {
+		std::cerr << "-build-index and -query need -index\n";
+		return -1;
+	}
+	if (BuildIndex)
+		return buildIndex(context);
+	if (!Queries.empty())
+		return queryIndex();
+	if (FileNames.empty()) {
+		std::cerr << "No input files\n";
 		return -1;
 	}
+
+	if (CostMode) {
+		InitializeAllTargetInfos();
+		InitializeAllTargets();
+		InitializeAllTargetMCs();
+		InitializeAllAsmPrinters();
+		InitializeAllAsmParsers();
+	}
+
 	raw_os_ostream O(std::cout);
-	for (Module::const_iterator i = m->getFunctionList().begin(), 
-	     e = m->getFunctionList().end(); i != e; ++i) {
-		if (!i->isDeclaration()) {
-			O << i->getName() << " has " << i->size() << " basic block(s).\n";
+	CostReport report;
+	int result = 0;
+	for (const std::string &fileName : FileNames) {
+		ErrorOr<std::unique_ptr<MemoryBuffer>> mb = MemoryBuffer::getFile(fileName);
+		if (!mb) {
+			std::cerr << "Error reading " << fileName << ": "
+			          << mb.getError().message() << "\n";
+			result = -1;
+			continue;
 		}
+		bool ok = analyzeBuffer((*mb)->getMemBufferRef(), "", context,
+			[&](const std::string &Name, Module &M) {
+				if (CostMode) {
+					costModule(Name, M, report);
+					return;
+				}
+				for (Module::const_iterator i = M.getFunctionList().begin(),
+				     e = M.getFunctionList().end(); i != e; ++i) {
+					if (!i->isDeclaration()) {
+						if (!Name.empty())
+							O << Name << ": ";
+						O << i->getName() << " has " << i->size() << " basic block(s).\n";
+					}
+				}
+			});
+		if (!ok)
+			result = -1;
 	}
-	return 0;
+	if (CostMode)
+		printCostReport(report, O);
+	return result;
 }
@@ -3,10 +3,61 @@
 
 #include <iostream>  // ostream, cout
 #include <cstring>   // strlen()
+#include <cstdio>    // rename()
 #include <algorithm> // copy()
 #include <new>       // bad_alloc
+#include <numeric>   // accumulate()
+#include <thread>    // thread
+#include <mutex>     // mutex, lock_guard, unique_lock
+#include <condition_variable>
+#include <atomic>    // atomic
+#include <deque>     // deque
+#include <vector>    // vector
+#include <memory>    // unique_ptr
+#include <functional>  // function
+#include <exception>   // exception_ptr, current_exception()
+#include <stdexcept> // runtime_error
+#include <string>    // string
+#include <climits>   // INT_MAX
+#include <cstdint>   // uint32_t, uint64_t
+#include <type_traits>  // is_trivially_copyable
+#include <fcntl.h>   // open()
+#include <unistd.h>  // close()
+#include <sys/mman.h>  // mmap(), munmap()
+#include <sys/stat.h>  // fstat()
+#include <sys/uio.h>   // writev()
 using namespace std;
 
+// How a Vector maps a file saved by Vector<T>::save()
+enum MapMode
+{
+  READ_ONLY,      // shared read-only pages; writing through [] crashes
+  COPY_ON_WRITE   // private pages; changes are not written to the file
+};
+
+// Header of a Vector file, followed by the elements at data_offset
+struct VectorFileHeader
+{
+  char magic[8];          // "VECTOR1"
+  uint32_t version;       // 1
+  uint32_t type_tag;      // vector_type_tag<T>()
+  uint32_t elem_size;     // sizeof(T)
+  uint32_t elem_align;    // alignof(T)
+  uint64_t count;         // number of elements
+  uint64_t data_offset;   // sizeof(VectorFileHeader)
+  char reserved[24];
+};
+
+// Identifies T in a Vector file: kind ('f', 'i', 'u', or 'b' for other
+// types) in the top byte, sizeof(T) below
+template <class T>
+constexpr uint32_t vector_type_tag()
+{
+  return uint32_t(is_floating_point<T>::value ? 'f' :
+                  !is_integral<T>::value ? 'b' :
+                  is_signed<T>::value ? 'i' : 'u') << 24 | sizeof(T);
+}
+
 // A Vector is a simplified vector with fixed size
 template <class T>
 class Vector
@@ -14,11 +65,16 @@ class Vector
 private:
   T *p;  // array of elements
   int n; // number of elements
+  char *map;      // start of the file mapping, or 0 if p is from new[]
+  size_t map_len; // length of the mapping
+  void release();  // free p
 public:
   explicit Vector(int i = 0);  // constructor without implicit conversion
+  Vector(const char* file, MapMode mode);  // map a file written by save()
   Vector(const Vector<T>& v);  // copy constructor
   Vector<T>& operator = (const Vector<T>& v);  // assignment operator
-  ~Vector() {delete[] p;}  // destructor
+  ~Vector() {release();}  // destructor
+  void save(const char* file) const;  // write elements to file
   int size() const {return n;}  // number of elements
   T& operator[](int i) {return p[i];}  // index operator
   const T& operator[](int i) const {return p[i];}  // read-only index op.
@@ -35,7 +91,7 @@ public:
 
 // Code for non-inlined Vector members: constructor
 template <class T>
-Vector<T>::Vector(int i): p(new T[i]), n(i)
+Vector<T>::Vector(int i): p(new T[i]), n(i), map(0), map_len(0)
 {
   for (int i=0; i<n; ++i)
     p[i] = T();
@@ -43,7 +99,8 @@ Vector<T>::Vector(int i): p(new T[i]), n(i)
 
 // Copy v
 template <class T>
-Vector<T>::Vector(const Vector<T>& v): p(new T[v.size()]), n(v.size())
+Vector<T>::Vector(const Vector<T>& v):
+  p(new T[v.size()]), n(v.size()), map(0), map_len(0)
 {
   copy(v.p, v.p+n, p);
 }
@@ -54,7 +111,7 @@ Vector<T>& Vector<T>::operator = (const Vector<T>& v)
 {
   if (&v != this)  // not assignment to self?
   {
-    delete[] p;
+    release();
     n = v.n;
     p = new T[n];
     copy(v.p, v.p+n, p);
@@ -62,6 +119,109 @@ Vector<T>& Vector<T>::operator = (const Vector<T>& v)
   return *this;  // return reference to self
 }
 
+template <class T>
+void Vector<T>::release()
+{
+  if (map)
+    munmap(map, map_len);
+  else
+    delete[] p;
+  p = 0;
+  map = 0;
+  map_len = 0;
+}
+
+// Map a file written by save() without copying it.  The elements are
+// read from disk as they are first touched.
+template <class T>
+Vector<T>::Vector(const char* file, MapMode mode):
+  p(0), n(0), map(0), map_len(0)
+{
+  static_assert(is_trivially_copyable<T>::value,
+                "only trivially copyable types can be mapped");
+  int fd = open(file, O_RDONLY);
+  if (fd < 0)
+    throw runtime_error(string("cannot open ") + file);
+  struct stat st;
+  if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(VectorFileHeader))
+  {
+    close(fd);
+    throw runtime_error(string("not a Vector file: ") + file);
+  }
+  size_t len = st.st_size;
+  void* base = mmap(0, len, mode == READ_ONLY ? PROT_READ : PROT_READ|PROT_WRITE,
+                    mode == READ_ONLY ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+  close(fd);  // the mapping keeps the file open
+  if (base == MAP_FAILED)
+    throw runtime_error(string("cannot map ") + file);
+
+  const VectorFileHeader& h = *static_cast<const VectorFileHeader*>(base);
+  if (memcmp(h.magic, "VECTOR1", 8) != 0 || h.version != 1
+      || h.type_tag != vector_type_tag<T>() || h.elem_size != sizeof(T)
+      || h.elem_align != alignof(T) || h.data_offset % alignof(T) != 0
+      || h.data_offset > len || h.count > INT_MAX
+      || h.count > (len - h.data_offset) / sizeof(T))
+  {
+    munmap(base, len);
+    throw runtime_error(string("bad Vector file or element type: ") + file);
+  }
+  map = static_cast<char*>(base);
+  map_len = len;
+  p = reinterpret_cast<T*>(map + h.data_offset);
+  n = int(h.count);
+}
+
+// Write the header and elements with one writev() (repeated only if the
+// kernel accepts less than everything, as Linux does above 2 GB) to
+// file.tmp, then rename it over file.  Truncating file in place would
+// pull the pages from under a Vector that maps it, even this one.
+template <class T>
+void Vector<T>::save(const char* file) const
+{
+  static_assert(is_trivially_copyable<T>::value,
+                "only trivially copyable types can be saved");
+  static_assert(alignof(T) <= sizeof(VectorFileHeader),
+                "element alignment exceeds the header size");
+  VectorFileHeader h = VectorFileHeader();
+  memcpy(h.magic, "VECTOR1", 8);
+  h.version = 1;
+  h.type_tag = vector_type_tag<T>();
+  h.elem_size = sizeof(T);
+  h.elem_align = alignof(T);
+  h.count = n;
+  h.data_offset = sizeof(h);
+
+  string tmp = string(file) + ".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if (fd < 0)
+    throw runtime_error("cannot create " + tmp);
+  iovec iov[2] = {{&h, sizeof(h)}, {p, n*sizeof(T)}};
+  int iovcnt = 2;
+  iovec* v = iov;
+  while (iovcnt > 0)
+  {
+    ssize_t w = writev(fd, v, iovcnt);
+    if (w <= 0)
+    {
+      close(fd);
+      unlink(tmp.c_str());
+      throw runtime_error("cannot write " + tmp);
+    }
+    for (; iovcnt > 0 && size_t(w) >= v->iov_len; ++v, --iovcnt)
+      w -= v->iov_len;
+    if (iovcnt > 0)
+    {
+      v->iov_base = static_cast<char*>(v->iov_base) + w;
+      v->iov_len -= w;
+    }
+  }
+  if (close(fd) < 0 || rename(tmp.c_str(), file) < 0)
+  {
+    unlink(tmp.c_str());
+    throw runtime_error(string("cannot write ") + file);
+  }
+}
+
 // Print a Vector with elements separated by sep
 template <class T>
 void print(ostream& out, const Vector<T>& v, const char* sep = "")
@@ -74,6 +234,302 @@ void print(ostream& out, const Vector<T>& v, const char* sep = "")
   }
 }
 
+// A ThreadPool runs tasks on worker threads.  Each worker owns a deque:
+// it pushes and pops its own tasks at the back and steals from the front
+// of the others when it runs dry.  Threads waiting for a task group help
+// run tasks instead of blocking, so tasks may wait on tasks they spawn.
+// A stolen task may wait and steal in turn, each on top of the last one's
+// stack, so a thread stops stealing (and only runs its own tasks) while
+// max_steal_depth stolen tasks are already on its stack.  Tasks must not
+// throw; TaskGroup below catches for them.
+class ThreadPool
+{
+private:
+  struct Queue
+  {
+    mutex m;
+    deque<function<void()> > tasks;
+  };
+  vector<unique_ptr<Queue> > queues;  // one per worker
+  vector<thread> workers;
+  atomic<int> queued;  // tasks in all queues
+  atomic<unsigned> next;  // queue for tasks submitted from outside
+  atomic<bool> done;
+  mutex idle_m;
+  condition_variable idle;
+  // Worker threads remember their pool, as a pool's task may submit to
+  // another pool with fewer queues.  stolen counts the stolen tasks on
+  // this thread's stack, whatever their pool.
+  struct Worker {const ThreadPool* pool; int index; int stolen;};
+  static Worker& worker() {static thread_local Worker w = {nullptr, -1, 0}; return w;}
+  static const int max_steal_depth = 16;
+  int self() const {return worker().pool == this ? worker().index : -1;}
+  bool run_one(bool steal);
+  void work(int i);
+public:
+  explicit ThreadPool(int threads = thread::hardware_concurrency());
+  ~ThreadPool();
+  int size() const {return int(workers.size());}
+  void submit(function<void()> f);
+  void wait(const atomic<int>& pending);  // run tasks until pending == 0
+};
+
+ThreadPool::ThreadPool(int threads): queued(0), next(0), done(false)
+{
+  if (threads < 1)
+    threads = 1;
+  for (int i=0; i<threads; ++i)
+    queues.push_back(unique_ptr<Queue>(new Queue));
+  for (int i=0; i<threads; ++i)
+    workers.push_back(thread(&ThreadPool::work, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    lock_guard<mutex> lock(idle_m);
+    done = true;
+  }
+  idle.notify_all();
+  for (thread& t: workers)
+    t.join();
+}
+
+// Queue f on the calling worker's deque, or spread over all of them
+void ThreadPool::submit(function<void()> f)
+{
+  int i = self();
+  if (i < 0)
+    i = next++ % queues.size();
+  {
+    lock_guard<mutex> lock(queues[i]->m);
+    queues[i]->tasks.push_back(std::move(f));
+  }
+  {
+    lock_guard<mutex> lock(idle_m);
+    ++queued;
+  }
+  idle.notify_one();
+}
+
+// Run one task, newest first from our own deque, else (if steal) oldest
+// from another
+bool ThreadPool::run_one(bool steal)
+{
+  int n = queues.size(), me = self();
+  if (me < 0 && !steal)
+    return false;
+  for (int k=0; k<(steal ? n : 1); ++k)
+  {
+    int i = me < 0 ? k : (me+k) % n;
+    Queue& q = *queues[i];
+    function<void()> f;
+    {
+      lock_guard<mutex> lock(q.m);
+      if (q.tasks.empty())
+        continue;
+      if (i == me)
+      {
+        f = std::move(q.tasks.back());
+        q.tasks.pop_back();
+      }
+      else
+      {
+        f = std::move(q.tasks.front());
+        q.tasks.pop_front();
+      }
+    }
+    --queued;
+    if (i == me)
+      f();
+    else
+    {
+      ++worker().stolen;
+      f();
+      --worker().stolen;
+    }
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::work(int i)
+{
+  worker().pool = this;
+  worker().index = i;
+  while (true)
+  {
+    if (run_one(true))
+      continue;
+    unique_lock<mutex> lock(idle_m);
+    idle.wait(lock, [this] {return done || queued > 0;});
+    if (done)
+      return;
+  }
+}
+
+void ThreadPool::wait(const atomic<int>& pending)
+{
+  while (pending > 0)
+    if (!run_one(worker().stolen < max_steal_depth))
+      this_thread::yield();
+}
+
+// The pool used by the parallel algorithms below
+ThreadPool& default_pool()
+{
+  static ThreadPool pool;
+  return pool;
+}
+
+// Tasks run on a pool that the caller waits for.  wait() rethrows the
+// first exception a task threw.  The destructor waits too, so a caller
+// that unwinds never leaves a task referring to its frame.
+class TaskGroup
+{
+private:
+  ThreadPool& pool;
+  atomic<int> pending;
+  mutex m;
+  exception_ptr error;
+public:
+  explicit TaskGroup(ThreadPool& p): pool(p), pending(0) {}
+  ~TaskGroup() {pool.wait(pending);}
+  template <class F> void run(F f);
+  void wait();
+};
+
+template <class F>
+void TaskGroup::run(F f)
+{
+  ++pending;
+  pool.submit([this, f] {
+    try
+    {
+      f();
+    }
+    catch (...)
+    {
+      lock_guard<mutex> lock(m);
+      if (!error)
+        error = current_exception();
+    }
+    --pending;
+  });
+}
+
+void TaskGroup::wait()
+{
+  pool.wait(pending);
+  if (error)
+    rethrow_exception(error);
+}
+
+// Ranges of at most this many elements are processed serially.  Aim for
+// about 8 pieces per thread so stealing can even out the load.
+inline long grain_size(long n, const ThreadPool& pool)
+{
+  const long min_grain = 4096;
+  return max(min_grain, n / (8L * pool.size()));
+}
+
+// Call f(first, last) on pieces of [first, last) of at most grain elements
+template <class T, class F>
+void parallel_for(T* first, T* last, long grain, F f, ThreadPool& pool)
+{
+  if (last - first <= grain)
+  {
+    f(first, last);
+    return;
+  }
+  T* mid = first + (last - first) / 2;
+  TaskGroup tasks(pool);
+  tasks.run([&] {parallel_for(mid, last, grain, f, pool);});
+  parallel_for(first, mid, grain, f, pool);
+  tasks.wait();
+}
+
+// Sort [first, last): sort the halves in parallel, then merge them
+template <class T>
+void parallel_sort(T* first, T* last, long grain, ThreadPool& pool)
+{
+  if (last - first <= grain)
+  {
+    sort(first, last);
+    return;
+  }
+  T* mid = first + (last - first) / 2;
+  TaskGroup tasks(pool);
+  tasks.run([&] {parallel_sort(mid, last, grain, pool);});
+  parallel_sort(first, mid, grain, pool);
+  tasks.wait();
+  inplace_merge(first, mid, last);
+}
+
+template <class T>
+void parallel_sort(T* first, T* last, ThreadPool& pool = default_pool())
+{
+  parallel_sort(first, last, grain_size(last - first, pool), pool);
+}
+
+template <class T>
+void parallel_sort(Vector<T>& v, ThreadPool& pool = default_pool())
+{
+  parallel_sort(v.begin(), v.end(), pool);
+}
+
+// out[i] = f(first[i]) for each element of [first, last)
+template <class T, class U, class F>
+void parallel_transform(const T* first, const T* last, U* out, F f,
+                        ThreadPool& pool = default_pool())
+{
+  parallel_for(first, last, grain_size(last - first, pool),
+               [=](const T* b, const T* e) {transform(b, e, out+(b-first), f);},
+               pool);
+}
+
+template <class T, class U, class F>
+void parallel_transform(const Vector<T>& in, Vector<U>& out, F f,
+                        ThreadPool& pool = default_pool())
+{
+  if (out.size() < in.size())
+    throw runtime_error("parallel_transform: out is smaller than in");
+  parallel_transform(in.begin(), in.end(), out.begin(), f, pool);
+}
+
+// Combine the elements of [first, last) with op.  op must be associative
+// and init an identity of it (e.g. 0 for +), since every piece starts
+// from init.
+template <class T, class R, class Op>
+R parallel_reduce(const T* first, const T* last, R init, Op op, long grain,
+                  ThreadPool& pool)
+{
+  if (last - first <= grain)
+    return accumulate(first, last, init, op);
+  const T* mid = first + (last - first) / 2;
+  R right = init;
+  TaskGroup tasks(pool);
+  tasks.run([&] {right = parallel_reduce(mid, last, init, op, grain, pool);});
+  R left = parallel_reduce(first, mid, init, op, grain, pool);
+  tasks.wait();
+  return op(left, right);
+}
+
+template <class T, class R, class Op>
+R parallel_reduce(const T* first, const T* last, R init, Op op,
+                  ThreadPool& pool = default_pool())
+{
+  return parallel_reduce(first, last, init, op,
+                         grain_size(last - first, pool), pool);
+}
+
+template <class T, class R, class Op>
+R parallel_reduce(const Vector<T>& v, R init, Op op,
+                  ThreadPool& pool = default_pool())
+{
+  return parallel_reduce(v.begin(), v.end(), init, op, pool);
+}
+
 // A String is a Vector<char> with a conversion from const char*
 class String: public Vector<char>
 {
@@ -93,6 +549,132 @@ ostream& operator << (ostream& out, const String& s)
   return out;
 }
 
+// A FixedVector is a Vector whose elements live inside the object (at
+// most N of them) instead of on the heap.  All of it is constexpr, so it
+// can be built, compared and hashed by the compiler.
+template <class T, int N>
+class FixedVector
+{
+private:
+  T p[N > 0 ? N : 1];  // array of elements
+  int n;               // number of elements
+public:
+  constexpr FixedVector(): p(), n(0) {}
+  constexpr explicit FixedVector(int i): p(), n(i < 0 ? 0 : i < N ? i : N) {}
+  constexpr int size() const {return n;}
+  static constexpr int capacity() {return N;}
+  constexpr T& operator[](int i) {return p[i];}
+  constexpr const T& operator[](int i) const {return p[i];}
+  constexpr void push_back(const T& x) {p[n++] = x;}  // requires size() < N
+
+  // iterators
+  typedef T* iterator;
+  constexpr iterator begin() {return p;}
+  constexpr iterator end() {return p+n;}
+  typedef const T* const_iterator;
+  constexpr const_iterator begin() const {return p;}
+  constexpr const_iterator end() const {return p+n;}
+};
+
+// Compare element by element; capacities may differ
+template <class T, int N, int M>
+constexpr bool operator == (const FixedVector<T, N>& a,
+                            const FixedVector<T, M>& b)
+{
+  if (a.size() != b.size())
+    return false;
+  for (int i=0; i<a.size(); ++i)
+    if (!(a[i] == b[i]))
+      return false;
+  return true;
+}
+
+template <class T, int N, int M>
+constexpr bool operator != (const FixedVector<T, N>& a,
+                            const FixedVector<T, M>& b)
+{
+  return !(a == b);
+}
+
+// One element's contribution to fnv_hash.  A char is taken as an unsigned
+// byte, so that characters above 0x7F do not sign extend.
+template <class T>
+constexpr unsigned long long fnv_value(const T& x)
+{
+  return static_cast<unsigned long long>(x);
+}
+
+constexpr unsigned long long fnv_value(char c)
+{
+  return static_cast<unsigned char>(c);
+}
+
+// 64-bit FNV-1a hash of the elements, which must convert to an integer
+template <class T, int N>
+constexpr unsigned long long fnv_hash(const FixedVector<T, N>& v)
+{
+  unsigned long long h = 14695981039346656037ULL;
+  for (int i=0; i<v.size(); ++i)
+  {
+    h ^= fnv_value(v[i]);
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+// A FixedString is a FixedVector<char, N> with a constexpr conversion
+// from a string literal of at most N characters.  Unlike String, it is
+// not NUL terminated.
+template <int N>
+class FixedString: public FixedVector<char, N>
+{
+public:
+  constexpr FixedString() {}
+  template <int M>
+  constexpr FixedString(const char (&s)[M]): FixedVector<char, N>(M-1)
+  {
+    static_assert(M-1 <= N, "string literal too long for FixedString");
+    for (int i=0; i<M-1; ++i)
+      (*this)[i] = s[i];
+  }
+};
+
+// FixedString sized to fit s, e.g. fixed("abc") is a FixedString<3>
+template <int M>
+constexpr FixedString<M-1> fixed(const char (&s)[M])
+{
+  return FixedString<M-1>(s);
+}
+
+// Print a FixedString
+template <int N>
+ostream& operator << (ostream& out, const FixedString<N>& s)
+{
+  out.write(s.begin(), s.size());
+  return out;
+}
+
+// A lookup table built at compile time.  It runs no code at startup and
+// is placed in read-only data.
+static constexpr FixedString<8> keywords[] = {
+  "class", "template", "public", "private", "explicit", "typedef"
+};
+static constexpr int num_keywords = sizeof(keywords) / sizeof(keywords[0]);
+
+// Index of s in keywords, or -1
+template <int N>
+constexpr int keyword_index(const FixedString<N>& s)
+{
+  for (int i=0; i<num_keywords; ++i)
+    if (keywords[i] == s)
+      return i;
+  return -1;
+}
+
+static_assert(keyword_index(fixed("public")) == 2, "");
+static_assert(keyword_index(fixed("virtual")) == -1, "");
+static_assert(fnv_hash(keywords[1]) == fnv_hash(fixed("template")), "");
+
 // Print "Hello world"
 int main()
 {
@@ -100,6 +682,54 @@ int main()
   {
     const String greeting = "Hello world";
     cout << greeting << endl;
+    constexpr auto hello = fixed("Hello world");  // no code at run time
+    cout << hello << " " << keywords[keyword_index(fixed("explicit"))] << endl;
+
+    // Sort and sum a large Vector on all cores
+    Vector<int> v(1000000);
+    for (int i=0; i<v.size(); ++i)
+      v[i] = v.size() - i;
+    parallel_sort(v);
+    Vector<long> sq(v.size());
+    parallel_transform(v, sq, [](int x) {return long(x) * x;});
+    cout << v[0] << ".." << v[v.size()-1] << " sum of squares "
+         << parallel_reduce(sq, 0L, plus<long>()) << endl;
+
+    // An exception thrown in a task reaches the caller
+    try
+    {
+      parallel_for(v.begin(), v.end(), 4096, [](int* b, int* e) {
+        if (find(b, e, 123456) != e)
+          throw runtime_error("found 123456");
+      }, default_pool());
+    }
+    catch (runtime_error& x)
+    {
+      cout << "parallel_for threw: " << x.what() << endl;
+    }
+
+    // Save a Vector and map it back.  Changes to a COPY_ON_WRITE mapping
+    // are private until saved, and saving replaces the file without
+    // disturbing mappings of the old one.
+    v.save("misc1.vec");
+    {
+      Vector<int> r("misc1.vec", READ_ONLY);
+      Vector<int> w("misc1.vec", COPY_ON_WRITE);
+      w[0] = -1;
+      w.save("misc1.vec");
+      cout << "mapped " << r.size() << " ints starting " << r[0]
+           << ", saved copy starts " << Vector<int>("misc1.vec", READ_ONLY)[0]
+           << endl;
+    }
+    try
+    {
+      Vector<double> d("misc1.vec", READ_ONLY);
+    }
+    catch (runtime_error& x)
+    {
+      cout << x.what() << endl;
+    }
+    remove("misc1.vec");
   }
   catch (bad_alloc x)
   {
@@ -816,4 +1446,64 @@ exception (defined in <stdexcept>), so
 
 will catch the bad_alloc exception.
 
+
+
+Constexpr.
+
+A function or constructor declared "constexpr" may be evaluated by the
+compiler when its arguments are constants, e.g.
+
+  constexpr auto hello = fixed("Hello world");
+  static_assert(hello.size() == 11, "");
+
+String cannot do this because it calls new and strlen() at run time.
+FixedString keeps its characters inside the object, so a constexpr
+FixedString (or an array of them, like keywords) is just bytes in the
+executable.  The template parameter N is its capacity, which must be
+known at compile time.
+
+
+
+Memory mapped files.
+
+A Vector of a type with no pointers or constructors (int, double, a
+plain struct) can be saved to a file and opened again without reading
+it:
+
+  v.save("data.vec");
+  Vector<double> w("data.vec", READ_ONLY);
+  cout << w[1000];
+
+mmap() makes the file part of the address space, so the elements are
+only read from disk when first used.  p then points into the mapping
+instead of to memory from new, which is why the destructor calls
+release() rather than delete[] directly.
+
+save() writes to a temporary file and renames it over the old one, so a
+Vector that still maps the old file (say w, opened COPY_ON_WRITE and
+changed) keeps its pages and can be saved back to the same name.
+
+
+
+Threads.
+
+parallel_sort(), parallel_transform() and parallel_reduce() split a
+Vector (or a range of pointers into one) in halves until the pieces are
+small, and hand the halves to a ThreadPool.  Each pool thread has its own
+queue of tasks and takes work from the other queues when its own is
+empty ("work stealing"), so all cores stay busy even when the pieces
+take different amounts of time.  Small Vectors are processed serially,
+since starting a task costs more than sorting a few thousand ints.
+
+A lambda expression such as
+
+  [&] {parallel_sort(mid, last, grain, pool);}
+
+is an unnamed function object.  [&] means it refers to the local
+variables it uses rather than copying them.  This is safe only because
+the caller waits (tasks.wait(), or the TaskGroup destructor if an
+exception unwinds the caller) before those variables go out of scope.
+An exception thrown by the task itself is caught on the worker thread,
+where nothing could handle it, and rethrown by tasks.wait().
+
 */
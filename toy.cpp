@@ -1,16 +1,58 @@
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/FunctionComparator.h"
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <map>
+#include <set>
 #include <vector>
 using namespace llvm;
 
-static LLVMContext Context;
+static orc::ThreadSafeContext TSContext(std::make_unique<LLVMContext>());
+static LLVMContext &Context = *TSContext.getContext();
 static Module *ModuleOb = new Module("my compiler", Context);
+static std::unique_ptr<orc::LLJIT> JIT;
+static ExitOnError ExitOnErr;
 
-Function *createFunc(IRBuilder<> &Builder, std::string Name){
+static cl::opt<bool> Instrument("instrument",
+	cl::desc("Count function and basic block executions"));
+static cl::opt<std::string> ProfOutput("prof-out",
+	cl::desc("Execution count dump file"), cl::init("toy.prof.json"));
+
+static cl::opt<bool> Lazy("lazy",
+	cl::desc("Compare lazy and eager JIT compilation of a generated workload"));
+static cl::opt<unsigned> CompileThreads("compile-threads",
+	cl::desc("Number of JIT compile threads"), cl::init(4));
+static cl::opt<bool> Speculate("speculate",
+	cl::desc("With -lazy, precompile the callees of each compiled function"));
+static cl::opt<unsigned> WorkFuncs("work-funcs",
+	cl::desc("Number of functions in the -lazy workload"), cl::init(500));
+static cl::opt<unsigned> WorkCalled("work-called",
+	cl::desc("Number of workload functions reached from run()"), cl::init(15));
+static cl::opt<bool> Dedup("dedup",
+	cl::desc("Merge structurally identical functions before verification"));
+
+Function *createFunc(IRBuilder<> &Builder, std::string Name,
+		ArrayRef<Type *> Params = None){
 	FunctionType *funcType = llvm::FunctionType::get(Builder.getInt32Ty(),
-	false);
+	Params, false);
 	Function *fooFunc = llvm::Function::Create(
 		funcType, llvm::Function::ExternalLinkage, Name, ModuleOb);
 	return fooFunc;
@@ -20,12 +62,659 @@ BasicBlock *createBB(Function *fooFunc, std::string Name){
 	return BasicBlock::Create(Context, Name, fooFunc);
 }
 
+// Specialization: a function is cloned with some of its arguments and the
+// globals it reads replaced by constants, optimized, and JIT compiled.
+// Bound arguments are dropped from the clone's signature.  A bound global
+// becomes constant for the whole clone, callees included, so the clone
+// must not write it.
+struct ArgBinding {
+	unsigned ArgNo;
+	Constant *Value;
+};
+
+struct GlobalBinding {
+	GlobalVariable *Global;
+	Constant *Value;
+};
+
+// Clones are keyed by function name and the printed bound values.
+static std::map<std::string, JITTargetAddress> SpecCache;
+
+static std::string specKey(Function *F, ArrayRef<ArgBinding> Args,
+		ArrayRef<GlobalBinding> Globals){
+	std::string Key;
+	raw_string_ostream OS(Key);
+	OS << F->getName();
+	for (const ArgBinding &A : Args) {
+		OS << "|%" << A.ArgNo << "=";
+		A.Value->printAsOperand(OS);
+	}
+	for (const GlobalBinding &G : Globals) {
+		OS << "|@" << G.Global->getName() << "=";
+		G.Value->printAsOperand(OS);
+	}
+	return OS.str();
+}
+
+static void optimizeModule(Module &M){
+	LoopAnalysisManager LAM;
+	FunctionAnalysisManager FAM;
+	CGSCCAnalysisManager CGAM;
+	ModuleAnalysisManager MAM;
+	PassBuilder PB;
+	PB.registerModuleAnalyses(MAM);
+	PB.registerCGSCCAnalyses(CGAM);
+	PB.registerFunctionAnalyses(FAM);
+	PB.registerLoopAnalyses(LAM);
+	PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+	ModulePassManager MPM =
+		PB.buildPerModuleDefaultPipeline(OptimizationLevel::O2);
+	MPM.run(M, MAM);
+}
+
+// Instrumentation: every basic block of an instrumented module gets a slot
+// in a contiguous i64 counter array that is bumped with a relaxed atomic
+// add on entry. A function's call count is the count of its entry block.
+// Counts points into the owning JIT until saveCounters() copies them out
+// before that JIT is destroyed.
+struct CounterTable {
+	std::string Symbol;
+	std::string Label; // which JIT ran the module
+	orc::LLJIT *Owner;
+	std::vector<std::pair<std::string, std::string>> Blocks; // (func, block)
+	uint64_t *Counts = nullptr;
+	std::vector<uint64_t> Saved;
+};
+
+static std::vector<CounterTable> CounterTables;
+
+static void instrumentModule(Module &M, orc::LLJIT &J, StringRef Label){
+	CounterTable Table;
+	Table.Symbol = "__toy_counters." + std::to_string(CounterTables.size());
+	Table.Label = Label.str();
+	Table.Owner = &J;
+	for (Function &F : M) {
+		for (BasicBlock &BB : F) {
+			std::string BBName = BB.hasName() ? BB.getName().str() :
+				"bb" + std::to_string(Table.Blocks.size());
+			Table.Blocks.emplace_back(F.getName().str(), BBName);
+		}
+	}
+	if (Table.Blocks.empty())
+		return;
+
+	IRBuilder<> Builder(M.getContext());
+	ArrayType *ArrTy = ArrayType::get(Builder.getInt64Ty(),
+		Table.Blocks.size());
+	GlobalVariable *Counters = new GlobalVariable(M, ArrTy, false,
+		GlobalValue::ExternalLinkage, ConstantAggregateZero::get(ArrTy),
+		Table.Symbol);
+	Counters->setAlignment(Align(64));
+
+	unsigned Idx = 0;
+	for (Function &F : M) {
+		for (BasicBlock &BB : F) {
+			Builder.SetInsertPoint(&*BB.getFirstInsertionPt());
+			Value *Slot = Builder.CreateConstInBoundsGEP2_32(ArrTy,
+				Counters, 0, Idx++);
+			Builder.CreateAtomicRMW(AtomicRMWInst::Add, Slot,
+				Builder.getInt64(1), MaybeAlign(8),
+				AtomicOrdering::Monotonic);
+		}
+	}
+	CounterTables.push_back(std::move(Table));
+}
+
+// Resolve the counter arrays of modules added to J since the last call.
+static void bindCounters(orc::LLJIT &J){
+	for (CounterTable &Table : CounterTables) {
+		if (Table.Owner == &J && !Table.Counts)
+			Table.Counts = jitTargetAddressToPointer<uint64_t *>(
+				ExitOnErr(J.lookup(Table.Symbol)).getAddress());
+	}
+}
+
+// Copy J's counts out of its memory; call before J is destroyed.
+static void saveCounters(orc::LLJIT &J){
+	bindCounters(J);
+	for (CounterTable &Table : CounterTables) {
+		if (Table.Owner != &J)
+			continue;
+		Table.Saved.resize(Table.Blocks.size());
+		for (unsigned I = 0, E = Table.Blocks.size(); I != E; ++I)
+			Table.Saved[I] = __atomic_load_n(&Table.Counts[I], __ATOMIC_RELAXED);
+		Table.Counts = Table.Saved.data();
+		Table.Owner = nullptr;
+	}
+}
+
+// Write the current counts as JSON; may be called at any time.
+void dumpCounters(StringRef Path){
+	std::error_code EC;
+	raw_fd_ostream OS(Path, EC, sys::fs::OF_Text);
+	if (EC) {
+		errs() << "Error writing " << Path << ": " << EC.message() << "\n";
+		return;
+	}
+	json::OStream J(OS, 1);
+	J.arrayBegin();
+	for (const CounterTable &Table : CounterTables) {
+		for (unsigned I = 0, E = Table.Blocks.size(); I != E; ++I) {
+			const std::string &Func = Table.Blocks[I].first;
+			if (I == 0 || Table.Blocks[I - 1].first != Func) {
+				if (I != 0) {
+					J.arrayEnd();
+					J.attributeEnd();
+					J.objectEnd();
+				}
+				J.objectBegin();
+				J.attribute("jit", Table.Label);
+				J.attribute("function", Func);
+				J.attribute("count", int64_t(__atomic_load_n(
+					&Table.Counts[I], __ATOMIC_RELAXED)));
+				J.attributeBegin("blocks");
+				J.arrayBegin();
+			}
+			J.objectBegin();
+			J.attribute("block", Table.Blocks[I].second);
+			J.attribute("count", int64_t(__atomic_load_n(
+				&Table.Counts[I], __ATOMIC_RELAXED)));
+			J.objectEnd();
+		}
+		J.arrayEnd();
+		J.attributeEnd();
+		J.objectEnd();
+	}
+	J.arrayEnd();
+	OS << "\n";
+}
+
+// The definitions F needs: F itself and every function, global variable
+// and alias reachable from it through operands and initializers.
+static SmallPtrSet<const GlobalValue *, 16> collectDefinitions(Function *F){
+	SmallPtrSet<const GlobalValue *, 16> Defs;
+	SmallPtrSet<const Value *, 32> Seen;
+	SmallVector<const Value *, 16> Worklist(1, F);
+	while (!Worklist.empty()) {
+		const Value *V = Worklist.pop_back_val();
+		if (!Seen.insert(V).second)
+			continue;
+		if (auto *GV = dyn_cast<GlobalValue>(V)) {
+			if (GV->isDeclaration())
+				continue;
+			Defs.insert(GV);
+			if (auto *Fn = dyn_cast<Function>(GV)) {
+				for (const Instruction &I : instructions(*Fn))
+					for (const Value *Op : I.operands())
+						if (isa<Constant>(Op))
+							Worklist.push_back(Op);
+			} else if (auto *Var = dyn_cast<GlobalVariable>(GV)) {
+				Worklist.push_back(Var->getInitializer());
+			} else if (auto *GA = dyn_cast<GlobalAlias>(GV)) {
+				Worklist.push_back(GA->getAliasee());
+			}
+		} else if (auto *C = dyn_cast<Constant>(V)) {
+			for (const Value *Op : C->operands())
+				Worklist.push_back(Op);
+		}
+	}
+	return Defs;
+}
+
+static Error checkBindings(Function *F, ArrayRef<ArgBinding> Args,
+		ArrayRef<GlobalBinding> Globals){
+	std::set<unsigned> Bound;
+	for (const ArgBinding &A : Args) {
+		if (A.ArgNo >= F->arg_size())
+			return make_error<StringError>(F->getName() + " has no argument " +
+				Twine(A.ArgNo), inconvertibleErrorCode());
+		if (A.Value->getType() != F->getArg(A.ArgNo)->getType())
+			return make_error<StringError>("Wrong type for argument " +
+				Twine(A.ArgNo) + " of " + F->getName(), inconvertibleErrorCode());
+		if (!Bound.insert(A.ArgNo).second)
+			return make_error<StringError>("Argument " + Twine(A.ArgNo) + " of " +
+				F->getName() + " is bound twice", inconvertibleErrorCode());
+	}
+	for (const GlobalBinding &G : Globals) {
+		if (G.Value->getType() != G.Global->getValueType())
+			return make_error<StringError>("Wrong type for global " +
+				G.Global->getName(), inconvertibleErrorCode());
+	}
+	return Error::success();
+}
+
+Expected<JITTargetAddress> specializeFunc(Function *F,
+		ArrayRef<ArgBinding> Args, ArrayRef<GlobalBinding> Globals = None){
+	if (Error Err = checkBindings(F, Args, Globals))
+		return Err;
+	std::string Key = specKey(F, Args, Globals);
+	auto It = SpecCache.find(Key);
+	if (It != SpecCache.end())
+		return It->second;
+
+	// Copy F and everything it needs into a fresh module.  The copies are
+	// made internal so that each clone owns its own, and ModuleOb never has
+	// to be added to the JIT.  Globals that are not bound keep their
+	// initial values; writes to them are private to the clone.  Bound
+	// globals get the bound value as a constant initializer, which O2
+	// folds into every read.
+	SmallPtrSet<const GlobalValue *, 16> Defs = collectDefinitions(F);
+	ValueToValueMapTy VMap;
+	std::unique_ptr<Module> M = CloneModule(*F->getParent(), VMap,
+		[&Defs](const GlobalValue *GV) { return Defs.count(GV) != 0; });
+	M->setDataLayout(JIT->getDataLayout());
+	for (GlobalValue &GV : M->global_values()) {
+		if (!GV.isDeclaration()) {
+			GV.setLinkage(GlobalValue::InternalLinkage);
+			GV.setVisibility(GlobalValue::DefaultVisibility);
+		}
+	}
+	Function *Src = cast<Function>(VMap[F]);
+
+	ValueToValueMapTy ArgMap;
+	for (const ArgBinding &A : Args)
+		ArgMap[Src->getArg(A.ArgNo)] = A.Value;
+	Function *Spec = CloneFunction(Src, ArgMap);
+	Spec->setName(F->getName() + ".spec" + Twine(SpecCache.size()));
+	Spec->setLinkage(GlobalValue::ExternalLinkage);
+	Spec->removeFnAttr(Attribute::OptimizeNone);
+	Spec->removeFnAttr(Attribute::NoInline);
+
+	for (const GlobalBinding &G : Globals) {
+		// Globals the clone never refers to were not copied.
+		auto *Copy = cast_or_null<GlobalVariable>(VMap.lookup(G.Global));
+		if (!Copy)
+			continue;
+		Copy->setInitializer(G.Value);
+		Copy->setConstant(true);
+		Copy->setLinkage(GlobalValue::InternalLinkage);
+	}
+
+	if (verifyModule(*M, &errs()))
+		return make_error<StringError>("Invalid specialization of " +
+			F->getName(), inconvertibleErrorCode());
+	optimizeModule(*M);
+	if (Instrument)
+		instrumentModule(*M, *JIT, "main");
+
+	std::string Name = Spec->getName().str();
+	if (Error Err = JIT->addIRModule(
+			orc::ThreadSafeModule(std::move(M), TSContext)))
+		return Err;
+	Expected<JITEvaluatedSymbol> Sym = JIT->lookup(Name);
+	if (!Sym)
+		return Sym.takeError();
+	bindCounters(*JIT);
+	SpecCache[Key] = Sym->getAddress();
+	return Sym->getAddress();
+}
+
+// Lazy JIT: the workload is a binary call tree work.0 -> work.1, work.2
+// -> ... of which only the first WorkCalled functions are reachable from
+// run(); the rest are never called.  Each has a chain of arithmetic so
+// compiling it takes measurable time.
+static void createWorkload(IRBuilder<> &Builder){
+	std::vector<Function *> work;
+	for (unsigned i = 0; i < WorkFuncs; ++i)
+		work.push_back(createFunc(Builder, "work." + std::to_string(i),
+			Builder.getInt32Ty()));
+	for (unsigned i = 0; i < WorkFuncs; ++i) {
+		Builder.SetInsertPoint(createBB(work[i], "entry"));
+		Value *X = work[i]->getArg(0);
+		for (unsigned j = 1; j <= 64; ++j)
+			X = Builder.CreateXor(Builder.CreateMul(X, Builder.getInt32(j | 1)),
+				Builder.CreateLShr(X, Builder.getInt32(j % 31 + 1)));
+		for (unsigned c = 2 * i + 1; c <= 2 * i + 2; ++c) {
+			if (c < WorkCalled && c < WorkFuncs)
+				X = Builder.CreateAdd(X, Builder.CreateCall(work[c], X));
+		}
+		Builder.CreateRet(X);
+	}
+	Function *runFunc = createFunc(Builder, "run", Builder.getInt32Ty());
+	Builder.SetInsertPoint(createBB(runFunc, "entry"));
+	Builder.CreateRet(Builder.CreateCall(work[0], runFunc->getArg(0)));
+}
+
+static uint64_t threadCPUNanos(){
+	timespec T;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &T);
+	return uint64_t(T.tv_sec) * 1000000000 + T.tv_nsec;
+}
+
+// Wraps the JIT's compiler to add the CPU time of every compile to Total.
+class TimedCompiler : public orc::IRCompileLayer::IRCompiler {
+	std::unique_ptr<orc::IRCompileLayer::IRCompiler> Inner;
+	std::atomic<uint64_t> &Total;
+
+public:
+	TimedCompiler(std::unique_ptr<orc::IRCompileLayer::IRCompiler> Inner,
+			std::atomic<uint64_t> &Total)
+		: IRCompiler(Inner->getManglingOptions()), Inner(std::move(Inner)),
+		  Total(Total) {}
+	Expected<std::unique_ptr<MemoryBuffer>> operator()(Module &M) override {
+		uint64_t Start = threadCPUNanos();
+		auto Obj = (*Inner)(M);
+		Total += threadCPUNanos() - Start;
+		return Obj;
+	}
+};
+
+template <class BuilderT>
+static BuilderT &setupJIT(BuilderT &B, std::atomic<uint64_t> &CompileNanos){
+	B.setNumCompileThreads(CompileThreads);
+	B.setCompileFunctionCreator([&CompileNanos](orc::JITTargetMachineBuilder JTMB)
+			-> Expected<std::unique_ptr<orc::IRCompileLayer::IRCompiler>> {
+		return std::make_unique<TimedCompiler>(
+			std::make_unique<orc::ConcurrentIRCompiler>(std::move(JTMB)),
+			CompileNanos);
+	});
+	return B;
+}
+
+// Before a function is compiled, ask for its callees too, so that they
+// compile on other threads while it runs.  Lookups in the ".impl" dylib
+// behind the lazy stubs trigger compilation; the results are ignored.
+static void speculateCallees(orc::LLLazyJIT &J, Module &M){
+	orc::ExecutionSession &ES = J.getExecutionSession();
+	orc::JITDylib *Impl = ES.getJITDylibByName(
+		J.getMainJITDylib().getName() + ".impl");
+	if (!Impl)
+		return;
+	orc::SymbolLookupSet Callees;
+	for (Function &F : M)
+		for (Instruction &I : instructions(F))
+			if (auto *CI = dyn_cast<CallInst>(&I))
+				if (Function *Callee = CI->getCalledFunction())
+					if (Callee->isDeclaration() && !Callee->isIntrinsic())
+						Callees.add(J.mangleAndIntern(Callee->getName()),
+							orc::SymbolLookupFlags::WeaklyReferencedSymbol);
+	if (Callees.empty())
+		return;
+	// A function may call the same callee twice; lookups need unique names.
+	Callees.removeDuplicates();
+	ES.lookup(orc::LookupKind::Static, orc::makeJITDylibSearchOrder(Impl),
+		std::move(Callees), orc::SymbolState::Ready,
+		[](Expected<orc::SymbolMap> R) { consumeError(R.takeError()); },
+		orc::NoDependenciesToRegister);
+}
+
+// A copy of ModuleOb with definitions only for run() and the workload.
+static std::unique_ptr<Module> cloneWorkload(){
+	ValueToValueMapTy VMap;
+	return CloneModule(*ModuleOb, VMap, [](const GlobalValue *GV) {
+		return GV->getName() == "run" || GV->getName().startswith("work.");
+	});
+}
+
+// Time from adding the workload to run() returning, and total compile CPU,
+// for the eager LLJIT and for LLLazyJIT.
+static void compareLazyJIT(){
+	typedef std::chrono::steady_clock Clock;
+	auto Millis = [](Clock::duration D) {
+		return std::chrono::duration<double, std::milli>(D).count();
+	};
+
+	for (bool IsLazy : {false, true}) {
+		std::atomic<uint64_t> CompileNanos(0);
+		std::unique_ptr<Module> M = cloneWorkload();
+		Clock::time_point Start = Clock::now();
+		int Result;
+		double FirstCall;
+		if (IsLazy) {
+			orc::LLLazyJITBuilder B;
+			std::unique_ptr<orc::LLLazyJIT> J = ExitOnErr(
+				setupJIT(B, CompileNanos).create());
+			if (Instrument)
+				instrumentModule(*M, *J, Speculate ? "lazy+speculate" : "lazy");
+			if (Speculate) {
+				orc::LLLazyJIT *JP = J.get();
+				J->getIRTransformLayer().setTransform(
+					[JP](orc::ThreadSafeModule TSM,
+					     orc::MaterializationResponsibility &) {
+						TSM.withModuleDo([JP](Module &PM) { speculateCallees(*JP, PM); });
+						return Expected<orc::ThreadSafeModule>(std::move(TSM));
+					});
+			}
+			ExitOnErr(J->addLazyIRModule(
+				orc::ThreadSafeModule(std::move(M), TSContext)));
+			Result = jitTargetAddressToFunction<int (*)(int)>(
+				ExitOnErr(J->lookup("run")).getAddress())(1);
+			FirstCall = Millis(Clock::now() - Start);
+			saveCounters(*J);
+		} else {
+			orc::LLJITBuilder B;
+			std::unique_ptr<orc::LLJIT> J = ExitOnErr(
+				setupJIT(B, CompileNanos).create());
+			if (Instrument)
+				instrumentModule(*M, *J, "eager");
+			ExitOnErr(J->addIRModule(
+				orc::ThreadSafeModule(std::move(M), TSContext)));
+			Result = jitTargetAddressToFunction<int (*)(int)>(
+				ExitOnErr(J->lookup("run")).getAddress())(1);
+			FirstCall = Millis(Clock::now() - Start);
+			saveCounters(*J);
+		}
+		// The JIT is gone here, so speculative compiles have finished.
+		outs() << (IsLazy ? (Speculate ? "lazy+speculate" : "lazy") : "eager")
+		       << ": run(1) = " << Result << ", first call after "
+		       << format("%.2f", FirstCall) << " ms, compile CPU "
+		       << format("%.2f", CompileNanos / 1e6) << " ms\n";
+	}
+}
+
+// Run time of the workload with and without counters, each compiled by
+// its own eager JIT.  The instrumented run's counts are kept for the dump.
+static void measureInstrumentation(){
+	typedef std::chrono::steady_clock Clock;
+	const int Calls = 20000;
+	double Nanos[2];
+	uint64_t Sum[2];
+	for (bool Counted : {false, true}) {
+		std::unique_ptr<Module> M = cloneWorkload();
+		std::unique_ptr<orc::LLJIT> J = ExitOnErr(orc::LLJITBuilder().create());
+		if (Counted)
+			instrumentModule(*M, *J, "overhead");
+		ExitOnErr(J->addIRModule(
+			orc::ThreadSafeModule(std::move(M), TSContext)));
+		auto *Run = jitTargetAddressToFunction<int (*)(int)>(
+			ExitOnErr(J->lookup("run")).getAddress());
+		Run(0);
+		// Best of a few rounds, to keep scheduling noise out.
+		Nanos[Counted] = 0;
+		for (int Round = 0; Round < 5; ++Round) {
+			Sum[Counted] = 0;
+			Clock::time_point Start = Clock::now();
+			for (int I = 0; I < Calls; ++I)
+				Sum[Counted] += uint32_t(Run(I));
+			double T = std::chrono::duration<double, std::nano>(
+				Clock::now() - Start).count();
+			if (Round == 0 || T < Nanos[Counted])
+				Nanos[Counted] = T;
+		}
+		if (Counted)
+			saveCounters(*J);
+	}
+	if (Sum[0] != Sum[1])
+		errs() << "instrumentation changed the workload's results\n";
+	outs() << "instrumentation: " << format("%.1f", Nanos[0] / Calls)
+	       << " -> " << format("%.1f", Nanos[1] / Calls) << " ns per run(), "
+	       << format("%.1f", 100 * (Nanos[1] / Nanos[0] - 1))
+	       << "% overhead (target < 5%)\n";
+}
+
+// Dedup: functions with structurally identical bodies are merged into the
+// first of them.  Direct calls are redirected to it; other uses keep the
+// duplicate, which becomes an alias if its address is insignificant and a
+// tail-calling thunk otherwise.  dedupFunctions() returns each merge.
+struct MergedFunction {
+	std::string Dup, Canon;
+	enum KindTy { Erased, Alias, Thunk } Kind;
+};
+
+static MergedFunction::KindTy mergeInto(Function *Dup, Function *Canon){
+	for (Use &U : make_early_inc_range(Dup->uses())) {
+		auto *CB = dyn_cast<CallBase>(U.getUser());
+		if (CB && CB->isCallee(&U))
+			U.set(Canon);
+	}
+	if (Dup->use_empty() && Dup->hasLocalLinkage()) {
+		Dup->eraseFromParent();
+		return MergedFunction::Erased;
+	}
+	if (Dup->hasGlobalUnnamedAddr()) {
+		GlobalAlias *Alias = GlobalAlias::create(Dup->getFunctionType(),
+			Dup->getAddressSpace(), Dup->getLinkage(), "", Canon,
+			Dup->getParent());
+		Alias->takeName(Dup);
+		Dup->replaceAllUsesWith(Alias);
+		Dup->eraseFromParent();
+		return MergedFunction::Alias;
+	}
+	// deleteBody() makes Dup external; the thunk keeps Dup's linkage.
+	GlobalValue::LinkageTypes Linkage = Dup->getLinkage();
+	GlobalValue::VisibilityTypes Visibility = Dup->getVisibility();
+	Dup->deleteBody();
+	Dup->setLinkage(Linkage);
+	Dup->setVisibility(Visibility);
+	IRBuilder<> Builder(createBB(Dup, "entry"));
+	std::vector<Value *> Args;
+	for (Argument &A : Dup->args())
+		Args.push_back(&A);
+	CallInst *CI = Builder.CreateCall(Canon, Args);
+	CI->setTailCall();
+	CI->setCallingConv(Canon->getCallingConv());
+	if (Dup->getReturnType()->isVoidTy())
+		Builder.CreateRetVoid();
+	else
+		Builder.CreateRet(CI);
+	return MergedFunction::Thunk;
+}
+
+std::vector<MergedFunction> dedupFunctions(Module &M){
+	std::vector<MergedFunction> Merged;
+	unsigned Round;
+	std::set<Function *> Thunks;
+	// Merging callees can make their callers identical, so repeat.
+	do {
+		Round = 0;
+		std::map<FunctionComparator::FunctionHash, std::vector<Function *>> Buckets;
+		for (Function &F : M) {
+			if (F.isDeclaration() || F.isInterposable() ||
+			    F.hasAvailableExternallyLinkage() || Thunks.count(&F))
+				continue;
+			// Skip functions still being built, like foo() in main().
+			if (any_of(F, [](BasicBlock &BB) { return !BB.getTerminator(); }))
+				continue;
+			Buckets[FunctionComparator::functionHash(F)].push_back(&F);
+		}
+		GlobalNumberState GlobalNumbers;
+		for (auto &Bucket : Buckets) {
+			std::vector<Function *> Canonical;
+			for (Function *F : Bucket.second) {
+				Function *Canon = nullptr;
+				for (Function *C : Canonical) {
+					if (FunctionComparator(C, F, &GlobalNumbers).compare() == 0) {
+						Canon = C;
+						break;
+					}
+				}
+				if (Canon) {
+					MergedFunction MF = {F->getName().str(), Canon->getName().str(),
+						MergedFunction::Erased};
+					MF.Kind = mergeInto(F, Canon);
+					if (MF.Kind == MergedFunction::Thunk)
+						Thunks.insert(F);
+					Merged.push_back(MF);
+					++Round;
+				} else {
+					Canonical.push_back(F);
+				}
+			}
+		}
+	} while (Round);
+	return Merged;
+}
+
+// Object size and codegen time of the host target for M.
+static std::pair<size_t, double> measureCodegen(Module &M){
+	std::unique_ptr<TargetMachine> TM = ExitOnErr(ExitOnErr(
+		orc::JITTargetMachineBuilder::detectHost()).createTargetMachine());
+	M.setDataLayout(TM->createDataLayout());
+	orc::SimpleCompiler Compile(*TM);
+	auto Start = std::chrono::steady_clock::now();
+	std::unique_ptr<MemoryBuffer> Obj = ExitOnErr(Compile(M));
+	return std::make_pair(Obj->getBufferSize(),
+		std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - Start).count());
+}
+
+static void reportDedup(){
+	std::unique_ptr<Module> Before = cloneWorkload();
+	std::vector<MergedFunction> Merged = dedupFunctions(*ModuleOb);
+	std::unique_ptr<Module> After = cloneWorkload();
+	std::pair<size_t, double> B = measureCodegen(*Before);
+	std::pair<size_t, double> A = measureCodegen(*After);
+	static const char *KindNames[] = {"erased", "alias", "thunk"};
+	for (const MergedFunction &MF : Merged)
+		outs() << "dedup: " << MF.Dup << " -> " << MF.Canon << " ("
+		       << KindNames[MF.Kind] << ")\n";
+	outs() << "dedup: merged " << Merged.size() << " function(s), object "
+	       << B.first << " -> " << A.first << " bytes, codegen "
+	       << format("%.2f", B.second) << " -> " << format("%.2f", A.second)
+	       << " ms\n";
+}
+
 int main(int argc, char *argv[]) {
+	cl::ParseCommandLineOptions(argc, argv, "toy compiler\n");
+	if (WorkFuncs == 0) {
+		errs() << "-work-funcs must be at least 1\n";
+		return 1;
+	}
+	InitializeNativeTarget();
+	InitializeNativeTargetAsmPrinter();
+	JIT = ExitOnErr(orc::LLJITBuilder().create());
+
 	static IRBuilder<> Builder(Context);
 	Function *fooFunc = createFunc(Builder, "foo");
 	BasicBlock *entry = createBB(fooFunc, "entry");
 	Builder.SetInsertPoint(entry);
 	verifyFunction(*fooFunc);
+
+	// int globvar = 12; int add(int a) { return globvar + a; }
+	GlobalVariable *globVar = new GlobalVariable(*ModuleOb,
+		Builder.getInt32Ty(), false, GlobalValue::ExternalLinkage,
+		Builder.getInt32(12), "globvar");
+	Function *addFunc = createFunc(Builder, "add", Builder.getInt32Ty());
+	Builder.SetInsertPoint(createBB(addFunc, "entry"));
+	Value *G = Builder.CreateLoad(Builder.getInt32Ty(), globVar);
+	Builder.CreateRet(Builder.CreateNSWAdd(G, addFunc->getArg(0)));
+	verifyFunction(*addFunc);
 	ModuleOb->dump();
+
+	GlobalBinding GV12 = {globVar, Builder.getInt32(12)};
+	auto *addSpec = jitTargetAddressToFunction<int (*)(int)>(
+		ExitOnErr(specializeFunc(addFunc, None, GV12)));
+	outs() << "add.spec(30) = " << addSpec(30) << "\n";
+	ArgBinding A30 = {0, Builder.getInt32(30)};
+	auto *addConst = jitTargetAddressToFunction<int (*)()>(
+		ExitOnErr(specializeFunc(addFunc, A30, GV12)));
+	outs() << "add.spec() = " << addConst() << "\n";
+	auto *addArg = jitTargetAddressToFunction<int (*)()>(
+		ExitOnErr(specializeFunc(addFunc, A30)));
+	outs() << "add.spec() with globvar unbound = " << addArg() << "\n";
+	if (Lazy || Dedup || Instrument) {
+		createWorkload(Builder);
+		if (Dedup)
+			reportDedup();
+		for (Function &F : *ModuleOb)
+			if (F.getName() == "run" || F.getName().startswith("work."))
+				verifyFunction(F, &errs());
+	}
+	if (Lazy)
+		compareLazyJIT();
+	if (Instrument) {
+		measureInstrumentation();
+		dumpCounters(ProfOutput);
+	}
 	return 0;
 }